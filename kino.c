@@ -8,23 +8,47 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <termios.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 /***defines***/
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define KINO_VERSION "1.0.0"
 #define KINO_TAB_STOP 8
 #define KINO_QUIT_TIMES 3
+#define KINO_WRITE_CHUNK (64 * 1024)
+#define KINO_LOAD_BATCH 16 // reads of child output (decompressor, filter) per poll round
+#define KINO_FILTER_REDRAW 16 // filter poll rounds between progress redraws
+#define KINO_LOAD_MIN_CHUNK (4 * 1024 * 1024) // files are split across cores in chunks at least this big
+#define KINO_LOAD_MAX_THREADS 64
+#define KINO_COLD_BLOCK 256 // rows per compressed block
+#define KINO_COLD_GUARD 256 // rows around the viewport and last edit that stay uncompressed
+#define KINO_COLD_LRU 8 // thawed blocks kept before they're compressed again
+#define KINO_REPLACE_MIN_ROWS (64 * 1024) // rows per thread for replace-all
+#define KINO_GAP_MIN (64 * 1024) // rows this long skip render and are edited through a gap
+#define KINO_RX_STEP 4096 // long rows with tabs remember their render column every this many chars
 
 
 
@@ -60,9 +84,45 @@ typedef struct erow {
     int rsize;
     char *chars;
     char *render;
+
+    // long rows have no render and keep gaplen unused bytes at gap inside chars,
+    // so typing only moves what's between the old and new cursor position
+    int gap;
+    int gaplen;
+    int tabs;
+
+    // stops[k] is the render column of char k * KINO_RX_STEP in a long row with tabs. the first
+    // nstops are known; edits only forget the ones past the edit point
+    int *stops;
+    int nstops, stopcap;
     
 } erow;
 
+// external compressor used to stream a file in and out, picked by magic bytes on open
+// or by file extension when saving a new file
+
+typedef struct editorCodec {
+    const char *name;
+    const char *magic;
+    int magiclen;
+    const char *ext;
+    char *decompress[4];
+    char *compress[4];
+} editorCodec;
+
+// a run of rows whose text is held LZ-compressed, see the cold rows section
+
+typedef struct coldBlock {
+    int first, count;
+    char *data;
+    int len; // compressed bytes
+    int raw; // sum of the rows' sizes
+} coldBlock;
+
+typedef struct coldRange {
+    int first, count;
+} coldRange;
+
 struct editorConfig {
     int cx, cy;
     int rx; // index of render field ( made for tab character )
@@ -74,7 +134,28 @@ struct editorConfig {
     erow *row;
     int dirty;
     char *filename;
-    char statusmsg[80];
+    const editorCodec *codec; // NULL for plain text files
+    int load_fd; // decompressor output still being read into rows, -1 when done
+    pid_t load_pid;
+    int partial; // last row came from a line without its '\n' yet
+    long long follow_off; // bytes of the file already turned into rows
+    int follow; // follow mode on
+    int follow_ifd; // inotify instance
+    int follow_wd; // watch on the file itself
+    int follow_dirwd; // watch on its directory, to catch a rotated file reappearing
+    int follow_fd; // open descriptor we read appended bytes from
+    ino_t follow_ino;
+    long long membudget; // bytes of uncompressed rows allowed, 0 = cold rows off
+    long long hot_bytes;
+    coldBlock *cold; // sorted by first row
+    int numcold;
+    coldRange *lru; // thawed blocks, least recently used first
+    int numlru;
+    long long cold_hits, cold_misses;
+    int lastedit; // row of the last edit, kept uncompressed
+    unsigned int *screenhash; // hash of what's on each screen line, 0 = unknown
+    int drawn_rowoff, drawn_coloff; // offsets the screen was last drawn at, -1 = unknown
+    char statusmsg[128];
     time_t statusmsg_time;
     struct termios orig_termios;
 
@@ -87,7 +168,10 @@ struct editorConfig E;
 
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
-char *editorPrompt(char *prompt);
+char *editorPrompt(char *prompt, int allowempty);
+void editorLoadFinish();
+void editorColdShift(int at, int n);
+erow *editorRowHot(int at);
 
 
 
@@ -150,7 +234,7 @@ struct editorConfig E;
 
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
-char *editorPrompt(char *prompt);
+char *editorPrompt(char *prompt, int allowempty);
 
 /*** terminal ***/
 
@@ -261,27 +345,82 @@ int getWindowSize(int *rows, int *cols) {
 /*** row operations ***/
 
 
-// converts  char index to render index
+// render column after chars [from, to), starting out at column rx
 // if its a tab we do rx % KINO_TAB_STOP to find out how many columns are we to the right
 
-int editorRowCxToRx(erow *row, int cx) {
-   int rx = 0;
+int editorRowWalkRx(erow *row, int from, int to, int rx) {
   int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
+  for (j = from; j < to; j++) {
+    if (row->chars[j < row->gap ? j : j + row->gaplen] == '\t')
       rx += (KINO_TAB_STOP - 1) - (rx % KINO_TAB_STOP);
     rx++;
   }
   return rx;
 }
 
+// last stop of a long row at or before char cx and render column rx, working out more stops
+// as needed. so cx->rx and drawing cost what's between the last edit and the cursor, not the row
+int editorRowStop(erow *row, int cx, int rx) {
+    if (row->nstops == 0) {
+        if (row->stopcap == 0) {
+            row->stopcap = row->size / KINO_RX_STEP + 2;
+            row->stops = malloc(sizeof(int) * row->stopcap);
+        }
+        row->stops[0] = 0;
+        row->nstops = 1;
+    }
+    int k = row->nstops - 1;
+    while ((k + 1) * KINO_RX_STEP <= cx && row->stops[k] <= rx) {
+        if (row->nstops == row->stopcap) {
+            row->stopcap = row->size / KINO_RX_STEP + 2;
+            row->stops = realloc(row->stops, sizeof(int) * row->stopcap);
+        }
+        row->stops[k + 1] = editorRowWalkRx(row, k * KINO_RX_STEP, (k + 1) * KINO_RX_STEP, row->stops[k]);
+        row->nstops++;
+        k++;
+    }
+
+    int lo = 0, hi = row->nstops - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (mid * KINO_RX_STEP <= cx && row->stops[mid] <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// chars [0, at) are untouched by an edit at at, and so are the stops among them
+void editorRowForgetStops(erow *row, int at) {
+    if (row->nstops > at / KINO_RX_STEP + 1) row->nstops = at / KINO_RX_STEP + 1;
+}
+
+// converts  char index to render index
+
+int editorRowCxToRx(erow *row, int cx) {
+   if (row->tabs == 0) return cx;
+   if (row->render == NULL) {
+       int k = editorRowStop(row, cx, INT_MAX);
+       return editorRowWalkRx(row, k * KINO_RX_STEP, cx, row->stops[k]);
+   }
+   return editorRowWalkRx(row, 0, cx, 0);
+}
+
+// expects chars without a gap. long rows stop here and are drawn a slice at a time
 void editorUpdateRow(erow *row) {
     int tabs = 0;
     int j;
     for (j = 0; j < row->size; j++)
         if (row->chars[j] == '\t') tabs++;
 
+    row->gap = row->size;
+    row->gaplen = 0;
+    row->tabs = tabs;
+    row->nstops = 0;
     free(row->render);
+    row->render = NULL;
+    row->rsize = 0;
+    if (row->size >= KINO_GAP_MIN) return;
+
     row->render = malloc(row->size + tabs*(KINO_TAB_STOP - 1) + 1);
 
     int idx = 0;
@@ -297,9 +436,16 @@ void editorUpdateRow(erow *row) {
     row->rsize = idx;
 }
 
+// memory a hot row holds, as counted in E.hot_bytes
+long long editorRowBytes(erow *row) {
+    if (row->chars == NULL) return 0;
+    return (long long)row->size + row->gaplen + row->rsize;
+}
+
 void editorInsertRow(int at, char *s, size_t len) {
     if (at < 0 || at > E.numrows) return;
 
+    editorColdShift(at, 1);
     E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
     memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
 
@@ -310,7 +456,10 @@ void editorInsertRow(int at, char *s, size_t len) {
 
     E.row[at].rsize = 0;
     E.row[at].render = NULL;
+    E.row[at].stops = NULL;
+    E.row[at].stopcap = 0;
     editorUpdateRow(&E.row[at]);
+    E.hot_bytes += editorRowBytes(&E.row[at]);
 
     E.numrows++;
     E.dirty++;
@@ -321,35 +470,89 @@ void editorInsertRow(int at, char *s, size_t len) {
 void editorFreeRow(erow *row) {
     free(row->render);
     free(row->chars);
+    free(row->stops);
 }
 
 void editorDelRow(int at) {
     if (at < 0 || at >= E.numrows) return;
+    editorColdShift(at, -1);
+    E.hot_bytes -= editorRowBytes(&E.row[at]);
     editorFreeRow(&E.row[at]);
     memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
     E.numrows--;
     E.dirty++;
 }
 
+// slide the gap to at. only the bytes in between move
+void editorRowMoveGap(erow *row, int at) {
+    if (at < row->gap)
+        memmove(&row->chars[at + row->gaplen], &row->chars[at], row->gap - at);
+    else if (at > row->gap)
+        memmove(&row->chars[row->gap], &row->chars[row->gap + row->gaplen], at - row->gap);
+    row->gap = at;
+}
+
+// close the gap so chars is a plain string again, for anything that reads the whole row
+char *editorRowFlatten(erow *row) {
+    if (row->gap != row->size) editorRowMoveGap(row, row->size);
+    row->chars[row->size] = '\0';
+    return row->chars;
+}
+
+// insert into a long row through its gap. the gap grows with the row so that
+// reallocs stay rare and each keystroke is O(1) amortized
+void editorRowGapInsert(erow *row, int at, const char *s, int len) {
+    if (row->gaplen < len) {
+        int grow = len + row->size / 8 + 1024;
+        row->chars = realloc(row->chars, row->size + grow + 1);
+        memmove(&row->chars[row->gap + grow], &row->chars[row->gap + row->gaplen],
+            row->size - row->gap);
+        row->gaplen = grow;
+    }
+    editorRowMoveGap(row, at);
+    editorRowForgetStops(row, at);
+    memcpy(&row->chars[row->gap], s, len);
+    row->gap += len;
+    row->gaplen -= len;
+    row->size += len;
+
+    int j;
+    for (j = 0; j < len; j++)
+        if (s[j] == '\t') row->tabs++;
+}
+
 // inserts character in defined row
 
 void editorRowInsertChar(erow *row, int at, int c) {
     if (at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    editorUpdateRow(row);
+    long long before = editorRowBytes(row);
+    if (row->render == NULL) {
+        char ch = c;
+        editorRowGapInsert(row, at, &ch, 1);
+    } else {
+        row->chars = realloc(row->chars, row->size + 2);
+        memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+        row->size++;
+        row->chars[at] = c;
+        editorUpdateRow(row);
+    }
+    E.hot_bytes += editorRowBytes(row) - before;
     E.dirty++;
 }
 
 
 void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
+    long long before = editorRowBytes(row);
+    if (row->render == NULL) {
+        editorRowGapInsert(row, row->size, s, len);
+    } else {
+        row->chars = realloc(row->chars, row->size + len + 1);
+        memcpy(&row->chars[row->size], s, len);
+        row->size += len;
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+    }
+    E.hot_bytes += editorRowBytes(row) - before;
     E.dirty++;
 }
 
@@ -357,9 +560,22 @@ void editorRowAppendString(erow *row, char *s, size_t len) {
 
 void editorRowDelChar(erow *row, int at) {
   if (at < 0 || at >= row->size) return;
+  if (row->render == NULL) {
+    // the deleted char just becomes part of the gap, so the row holds as much memory as before
+    editorRowMoveGap(row, at + 1);
+    editorRowForgetStops(row, at);
+    row->gap--;
+    row->gaplen++;
+    row->size--;
+    if (row->chars[at] == '\t') row->tabs--;
+    E.dirty++;
+    return;
+  }
+  long long before = editorRowBytes(row);
   memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
   row->size--;
   editorUpdateRow(row);
+  E.hot_bytes += editorRowBytes(row) - before;
   E.dirty++;
 }
 
@@ -373,22 +589,26 @@ void editorInsertChar(int c) {
     if (E.cy == E.numrows) {
         editorInsertRow(E.numrows, "", 0);
     }
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
+    E.lastedit = E.cy;
+    editorRowInsertChar(editorRowHot(E.cy), E.cx, c);
     E.cx++;
 }
 
 // if at beginning of line, add new row; else split the line into 2, passing the right of cursor to insertRow
 // reassign row pointer, reassign size of the current row to cursor position
 void editorInsertNewline() {
+  E.lastedit = E.cy;
   if (E.cx == 0) {
     editorInsertRow(E.cy, "", 0);
   } else {
-    erow *row = &E.row[E.cy];
-    editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+    erow *row = editorRowHot(E.cy);
+    editorInsertRow(E.cy + 1, &editorRowFlatten(row)[E.cx], row->size - E.cx);
     row = &E.row[E.cy];
+    long long before = editorRowBytes(row);
     row->size = E.cx;
     row->chars[row->size] = '\0';
     editorUpdateRow(row);
+    E.hot_bytes += editorRowBytes(row) - before;
   }
   E.cy++;
   E.cx = 0;
@@ -401,41 +621,879 @@ void editorDelChar() {
   if (E.cy == E.numrows) return;
   if (E.cx == 0 && E.cy == 0) return;
 
-  erow *row = &E.row[E.cy];
+  E.lastedit = E.cy;
+  erow *row = editorRowHot(E.cy);
   if (E.cx > 0) {
     editorRowDelChar(row, E.cx - 1);
     E.cx--;
   } else {
     E.cx = E.row[E.cy - 1].size;
-    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+    editorRowAppendString(editorRowHot(E.cy - 1), editorRowFlatten(row), row->size);
     editorDelRow(E.cy);
     E.cy--;
   }
 }
 
- 
-/*** file i/o ***/
+/*** cold rows ***/
+
+// optional memory saver (KINO_MEM_BUDGET=<MB>): once the uncompressed rows go over budget,
+// runs of rows far from the viewport and the last edit are packed into LZ-compressed blocks.
+// a cold row keeps size/rsize but has chars == render == NULL until it's thawed again
+
+// LZF-style codec. control byte < 32: literal run of ctrl + 1 bytes follows.
+// otherwise a back reference: length (ctrl >> 5) + 2, 7 meaning an extra length byte follows,
+// distance ((ctrl & 31) << 8 | next byte) + 1
+
+#define LZ_HASH_BITS 13
+#define LZ_MAX_OFF 8192
+#define LZ_MAX_LEN (7 + 255 + 2)
+
+// worst case output is inlen + inlen / 32 + 1
+int lzCompress(const unsigned char *in, int inlen, unsigned char *out) {
+    int htab[1 << LZ_HASH_BITS] = {0};
+    int ip = 0, op = 1; // out[0] is reserved for the first literal run's control byte
+    int lit = 0;
+
+    while (ip < inlen) {
+        if (ip + 2 < inlen) {
+            unsigned int v = in[ip] << 16 | in[ip + 1] << 8 | in[ip + 2];
+            unsigned int h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+            int ref = htab[h] - 1;
+            htab[h] = ip + 1;
+
+            if (ref >= 0 && ip - ref <= LZ_MAX_OFF && memcmp(&in[ref], &in[ip], 3) == 0) {
+                int maxlen = inlen - ip < LZ_MAX_LEN ? inlen - ip : LZ_MAX_LEN;
+                int len = 3;
+                while (len < maxlen && in[ref + len] == in[ip + len]) len++;
+
+                // close the pending literal run, or take back its unused control byte
+                if (lit) out[op - lit - 1] = lit - 1;
+                else op--;
+
+                int off = ip - ref - 1;
+                int l = len - 2;
+                if (l < 7) {
+                    out[op++] = (l << 5) | (off >> 8);
+                } else {
+                    out[op++] = (7 << 5) | (off >> 8);
+                    out[op++] = l - 7;
+                }
+                out[op++] = off & 0xff;
 
+                ip += len;
+                lit = 0;
+                op++;
+                continue;
+            }
+        }
 
+        out[op++] = in[ip++];
+        if (++lit == 32) {
+            out[op - lit - 1] = lit - 1;
+            lit = 0;
+            op++;
+        }
+    }
+    if (lit) out[op - lit - 1] = lit - 1;
+    else op--;
+    return op;
+}
 
-// calculate length of each row, append it to buflen, loop and memcopy, return buf
-char *editorRowsToString(int *buflen) {
-    int totlen = 0;
+// returns the number of bytes produced, -1 on corrupt input
+int lzDecompress(const unsigned char *in, int inlen, unsigned char *out, int outlen) {
+    int ip = 0, op = 0;
+    while (ip < inlen) {
+        unsigned int ctrl = in[ip++];
+        if (ctrl < 32) {
+            int n = ctrl + 1;
+            if (ip + n > inlen || op + n > outlen) return -1;
+            memcpy(&out[op], &in[ip], n);
+            ip += n;
+            op += n;
+        } else {
+            int len = ctrl >> 5;
+            if (len == 7) {
+                if (ip >= inlen) return -1;
+                len += in[ip++];
+            }
+            len += 2;
+            if (ip >= inlen) return -1;
+            int ref = op - (((ctrl & 31) << 8) | in[ip++]) - 1;
+            if (ref < 0 || op + len > outlen) return -1;
+            while (len--) out[op++] = out[ref++]; // ranges may overlap
+        }
+    }
+    return op;
+}
+
+// index of the frozen block holding row at, or -1
+int editorColdFind(int at) {
+    int lo = 0, hi = E.numcold - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (at < E.cold[mid].first) hi = mid - 1;
+        else if (at >= E.cold[mid].first + E.cold[mid].count) lo = mid + 1;
+        else return mid;
+    }
+    return -1;
+}
+
+// decompress a block's text into a fresh buffer. caller frees
+char *editorColdUnpack(coldBlock *b) {
+    char *buf = malloc(b->raw ? b->raw : 1);
+    if (lzDecompress((unsigned char *)b->data, b->len, (unsigned char *)buf, b->raw) != b->raw)
+        die("cold block corrupt");
+    return buf;
+}
+
+// remember a range that was just thawed, most recent last
+void editorColdTouch(int first, int count) {
+    E.lru = realloc(E.lru, sizeof(coldRange) * (E.numlru + 1));
+    E.lru[E.numlru++] = (coldRange){first, count};
+}
+
+// row at was read: move its thawed range, if any, to the most recent end.
+// returns 1 if that was a switch from another block, so repeat reads of one block count once
+int editorColdUse(int at) {
     int j;
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1;
-    *buflen = totlen;
+    for (j = E.numlru - 1; j >= 0; j--) {
+        coldRange r = E.lru[j];
+        if (at < r.first || at >= r.first + r.count) continue;
+        if (j == E.numlru - 1) return 0;
+        memmove(&E.lru[j], &E.lru[j + 1], sizeof(coldRange) * (E.numlru - j - 1));
+        E.lru[E.numlru - 1] = r;
+        return 1;
+    }
+    return 0;
+}
+
+void editorColdThaw(int idx) {
+    coldBlock b = E.cold[idx];
+    memmove(&E.cold[idx], &E.cold[idx + 1], sizeof(coldBlock) * (E.numcold - idx - 1));
+    E.numcold--;
 
-    char *buf = malloc(totlen);
+    char *buf = editorColdUnpack(&b);
     char *p = buf;
-    for (j = 0; j < E.numrows; j++) {
+    int j;
+    for (j = b.first; j < b.first + b.count; j++) {
+        erow *row = &E.row[j];
+        row->chars = malloc(row->size + 1);
+        memcpy(row->chars, p, row->size);
+        row->chars[row->size] = '\0';
+        p += row->size;
+        editorUpdateRow(row);
+        E.hot_bytes += editorRowBytes(row);
+    }
+    free(buf);
+    free(b.data);
+    E.cold_misses++;
+    editorColdTouch(b.first, b.count);
+}
+
+// make sure row at has its text in memory. every reader of chars/render goes through this
+// hits and misses both count block accesses: a miss thaws a block, a hit reuses a thawed one
+erow *editorRowHot(int at) {
+    erow *row = &E.row[at];
+    if (!E.membudget) return row;
+    // rows on screen are hot by construction, so redraws keep them fresh without counting
+    int shown = at >= E.rowoff && at < E.rowoff + E.screenrows;
+    if (row->chars == NULL) {
+        editorColdThaw(editorColdFind(at));
+    } else if (editorColdUse(at) && !shown) {
+        E.cold_hits++;
+    }
+    return row;
+}
+
+// compress rows [first, first + count) into a block. all of them must be hot
+void editorColdFreeze(int first, int count) {
+    int raw = 0;
+    int j;
+    for (j = first; j < first + count; j++) {
+        if (E.row[j].chars == NULL) return;
+        raw += E.row[j].size;
+    }
+    // empty rows hold no text worth packing
+    if (raw == 0) return;
+    for (j = first; j < first + count; j++) editorRowFlatten(&E.row[j]);
+
+    char *buf = malloc(raw);
+    char *p = buf;
+    for (j = first; j < first + count; j++) {
         memcpy(p, E.row[j].chars, E.row[j].size);
         p += E.row[j].size;
-        *p = '\n';
-        p++;
     }
+    char *out = malloc(raw + raw / 32 + 16);
+    int len = lzCompress((unsigned char *)buf, raw, (unsigned char *)out);
+    free(buf);
 
-    return buf;
+    for (j = first; j < first + count; j++) {
+        E.hot_bytes -= editorRowBytes(&E.row[j]);
+        editorFreeRow(&E.row[j]);
+        E.row[j].chars = NULL;
+        E.row[j].render = NULL;
+        E.row[j].stops = NULL;
+        E.row[j].stopcap = 0;
+    }
+
+    // keep E.cold sorted by first row
+    int idx = 0;
+    while (idx < E.numcold && E.cold[idx].first < first) idx++;
+    E.cold = realloc(E.cold, sizeof(coldBlock) * (E.numcold + 1));
+    memmove(&E.cold[idx + 1], &E.cold[idx], sizeof(coldBlock) * (E.numcold - idx));
+    E.cold[idx] = (coldBlock){first, count, realloc(out, len), len, raw};
+    E.numcold++;
+
+    // frozen rows are no longer in the thawed set
+    for (j = 0; j < E.numlru; j++) {
+        if (E.lru[j].first < first + count && first < E.lru[j].first + E.lru[j].count) {
+            memmove(&E.lru[j], &E.lru[j + 1], sizeof(coldRange) * (E.numlru - j - 1));
+            E.numlru--;
+            j--;
+        }
+    }
+}
+
+// keep block bookkeeping right when rows [at, at + n) are inserted (n > 0) or deleted (n < 0).
+// a block the change lands inside is thawed first
+void editorColdShift(int at, int n) {
+    if (!E.membudget) return;
+    int end = n < 0 ? at - n : at;
+    int j;
+
+    for (j = 0; j < E.numcold; j++) {
+        coldBlock *b = &E.cold[j];
+        int inside = n > 0 ? (at > b->first && at < b->first + b->count)
+                           : (at < b->first + b->count && end > b->first);
+        if (inside) {
+            editorColdThaw(j);
+            j--;
+        }
+    }
+    for (j = 0; j < E.numcold; j++) {
+        if (E.cold[j].first >= at) E.cold[j].first += n;
+    }
+
+    for (j = 0; j < E.numlru; j++) {
+        coldRange *r = &E.lru[j];
+        if (r->first >= end) {
+            r->first += n;
+        } else if (r->first + r->count > at) {
+            // overlaps the change: grow by the insert, or lose the deleted rows
+            int lo = at > r->first ? at : r->first;
+            int hi = end < r->first + r->count ? end : r->first + r->count;
+            r->count += n > 0 ? n : lo - hi;
+            if (at < r->first) r->first = at;
+        }
+    }
+}
+
+void editorColdRecount() {
+    int j;
+    E.hot_bytes = 0;
+    for (j = 0; j < E.numrows; j++) {
+        E.hot_bytes += editorRowBytes(&E.row[j]);
+    }
+}
+
+// rows within KINO_COLD_GUARD of the viewport or the last edit are never frozen
+int editorColdGuarded(int first, int count) {
+    int vlo = E.rowoff - KINO_COLD_GUARD;
+    int vhi = E.rowoff + E.screenrows + KINO_COLD_GUARD;
+    int elo = E.lastedit - KINO_COLD_GUARD;
+    int ehi = E.lastedit + KINO_COLD_GUARD;
+    int end = first + count;
+    return (first < vhi && end > vlo) || (first < ehi && end > elo);
+}
+
+// rows in a thawed range still in the LRU are left to it
+int editorColdRecent(int first, int count) {
+    int j;
+    for (j = 0; j < E.numlru; j++) {
+        if (E.lru[j].first < first + count && first < E.lru[j].first + E.lru[j].count) return 1;
+    }
+    return 0;
+}
+
+// drop the least recently used thawed range, packing it again unless it's guarded
+void editorColdEvict() {
+    coldRange r = E.lru[0];
+    memmove(&E.lru[0], &E.lru[1], sizeof(coldRange) * (E.numlru - 1));
+    E.numlru--;
+    if (r.count > 0 && r.first + r.count <= E.numrows && !editorColdGuarded(r.first, r.count))
+        editorColdFreeze(r.first, r.count);
+}
+
+// run between keypresses, never while a row pointer is held: first refreeze thawed blocks that
+// fell out of the LRU, then freeze blocks from whichever end of the file is farther from the
+// viewport until we're back under budget. recently used blocks go last, oldest first
+void editorColdMaintain() {
+    if (!E.membudget) return;
+
+    while (E.numlru > KINO_COLD_LRU) editorColdEvict();
+
+    if (E.hot_bytes <= E.membudget) return;
+
+    int lo = 0;
+    int hi = (E.numrows - 1) / KINO_COLD_BLOCK * KINO_COLD_BLOCK;
+    int mid = E.rowoff + E.screenrows / 2;
+    while (E.hot_bytes > E.membudget && lo <= hi) {
+        int first;
+        if (mid - lo >= hi - mid) {
+            first = lo;
+            lo += KINO_COLD_BLOCK;
+        } else {
+            first = hi;
+            hi -= KINO_COLD_BLOCK;
+        }
+        int count = E.numrows - first < KINO_COLD_BLOCK ? E.numrows - first : KINO_COLD_BLOCK;
+        if (E.row[first].chars && !editorColdGuarded(first, count) && !editorColdRecent(first, count))
+            editorColdFreeze(first, count);
+    }
+    while (E.hot_bytes > E.membudget && E.numlru > 0) editorColdEvict();
+}
+
+// read access to row text without thawing anything, for save and friends:
+// a cold row is served from one decompressed block kept in scratch
+struct coldReader {
+    int first, count;
+    char *buf;
+    char *p;
+    int next;
+};
+
+#define COLD_READER_INIT {0, 0, NULL, NULL, -1}
+
+const char *editorColdPeek(struct coldReader *r, int at) {
+    if (E.row[at].chars) return editorRowFlatten(&E.row[at]);
+
+    if (at < r->first || at >= r->first + r->count) {
+        coldBlock *b = &E.cold[editorColdFind(at)];
+        free(r->buf);
+        r->buf = editorColdUnpack(b);
+        r->first = b->first;
+        r->count = b->count;
+        r->next = -1;
+    }
+    // sequential reads just move along, anything else walks the sizes from the block start
+    if (r->next != at) {
+        int j;
+        r->p = r->buf;
+        for (j = r->first; j < at; j++) r->p += E.row[j].size;
+    }
+    const char *s = r->p;
+    r->p += E.row[at].size;
+    r->next = at + 1;
+    return s;
+}
+
+void editorColdReaderFree(struct coldReader *r) {
+    free(r->buf);
+}
+
+
+/*** replace ***/
+
+// replace-all rebuilds every matching row once: count the matches, allocate the new row,
+// copy around them, re-render. rows are split across threads by range
+
+struct replaceJob {
+    const char *find;
+    int findlen;
+    const char *with;
+    int withlen;
+    int first, last; // row range [first, last)
+    long long count;
+    long long delta; // change in hot bytes
+};
+
+// returns the number of replacements made in row
+int editorRowReplace(erow *row, const char *find, int findlen, const char *with, int withlen) {
+    int count = 0;
+    const char *p = editorRowFlatten(row);
+    const char *end = row->chars + row->size;
+    const char *m;
+    while ((m = memmem(p, end - p, find, findlen)) != NULL) {
+        count++;
+        p = m + findlen;
+    }
+    if (count == 0) return 0;
+
+    int newsize = row->size + count * (withlen - findlen);
+    char *chars = malloc(newsize + 1);
+    char *out = chars;
+    p = row->chars;
+    while ((m = memmem(p, end - p, find, findlen)) != NULL) {
+        memcpy(out, p, m - p);
+        out += m - p;
+        memcpy(out, with, withlen);
+        out += withlen;
+        p = m + findlen;
+    }
+    memcpy(out, p, end - p);
+    chars[newsize] = '\0';
+
+    free(row->chars);
+    row->chars = chars;
+    row->size = newsize;
+    editorUpdateRow(row);
+    return count;
+}
+
+// cold rows are skipped here and handled block by block afterwards
+void *editorReplaceRange(void *arg) {
+    struct replaceJob *job = arg;
+    int j;
+    for (j = job->first; j < job->last; j++) {
+        erow *row = &E.row[j];
+        if (row->chars == NULL) continue;
+        long long before = editorRowBytes(row);
+        int n = editorRowReplace(row, job->find, job->findlen, job->with, job->withlen);
+        if (n) {
+            job->count += n;
+            job->delta += editorRowBytes(row) - before;
+        }
+    }
+    return NULL;
+}
+
+// a cold block is only thawed when its text contains a match, and packed again right after
+long long editorReplaceCold(struct replaceJob *job) {
+    int ncold = E.numcold;
+    coldRange *blocks = malloc(sizeof(coldRange) * (ncold ? ncold : 1));
+    long long count = 0;
+    int j, k;
+    for (j = 0; j < ncold; j++)
+        blocks[j] = (coldRange){E.cold[j].first, E.cold[j].count};
+
+    for (j = 0; j < ncold; j++) {
+        int idx = editorColdFind(blocks[j].first);
+        if (idx == -1) continue;
+        char *raw = editorColdUnpack(&E.cold[idx]);
+        int hit = memmem(raw, E.cold[idx].raw, job->find, job->findlen) != NULL;
+        free(raw);
+        if (!hit) continue;
+
+        editorColdThaw(idx);
+        for (k = blocks[j].first; k < blocks[j].first + blocks[j].count; k++) {
+            erow *row = &E.row[k];
+            long long before = editorRowBytes(row);
+            count += editorRowReplace(row, job->find, job->findlen, job->with, job->withlen);
+            E.hot_bytes += editorRowBytes(row) - before;
+        }
+        editorColdFreeze(blocks[j].first, blocks[j].count);
+    }
+    free(blocks);
+    return count;
+}
+
+long long editorReplace(const char *find, const char *with) {
+    editorLoadFinish();
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = E.numrows / KINO_REPLACE_MIN_ROWS + 1;
+    if (ncpu > 0 && nthreads > ncpu) nthreads = ncpu;
+    if (nthreads > KINO_LOAD_MAX_THREADS) nthreads = KINO_LOAD_MAX_THREADS;
+
+    struct replaceJob jobs[KINO_LOAD_MAX_THREADS];
+    pthread_t threads[KINO_LOAD_MAX_THREADS];
+    int spawned[KINO_LOAD_MAX_THREADS] = {0};
+    int first = 0;
+    int j;
+    for (j = 0; j < nthreads; j++) {
+        int n = E.numrows / nthreads + (j < E.numrows % nthreads);
+        jobs[j] = (struct replaceJob){find, strlen(find), with, strlen(with), first, first + n, 0, 0};
+        first += n;
+    }
+
+    // job 0 runs on this thread, same as the loader
+    for (j = 1; j < nthreads; j++) {
+        spawned[j] = pthread_create(&threads[j], NULL, editorReplaceRange, &jobs[j]) == 0;
+        if (!spawned[j]) editorReplaceRange(&jobs[j]);
+    }
+    editorReplaceRange(&jobs[0]);
+
+    long long count = 0;
+    for (j = 0; j < nthreads; j++) {
+        if (spawned[j]) pthread_join(threads[j], NULL);
+        count += jobs[j].count;
+        E.hot_bytes += jobs[j].delta;
+    }
+    if (E.membudget) count += editorReplaceCold(&jobs[0]);
+
+    if (count) E.dirty++;
+    if (E.cy < E.numrows && E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+    return count;
+}
+
+void editorReplaceAll() {
+    char *find = editorPrompt("Replace: %s (ESC to cancel)", 0);
+    if (find == NULL) return;
+    char *with = editorPrompt("Replace with: %s (ESC to cancel)", 1);
+    if (with == NULL) {
+        free(find);
+        return;
+    }
+
+    long long count = editorReplace(find, with);
+    editorSetStatusMessage("Replaced %lld occurrence%s of '%s'", count, count == 1 ? "" : "s", find);
+    free(find);
+    free(with);
+}
+
+
+/*** file i/o ***/
+
+
+
+static const editorCodec codecs[] = {
+    {"gzip", "\x1f\x8b", 2, ".gz", {"gzip", "-dc", NULL}, {"gzip", "-c", NULL}},
+    {"zstd", "\x28\xb5\x2f\xfd", 4, ".zst", {"zstd", "-dcq", NULL}, {"zstd", "-cq", NULL}},
+};
+
+#define KINO_NUM_CODECS (int)(sizeof(codecs) / sizeof(codecs[0]))
+
+const editorCodec *editorCodecFromMagic(const char *buf, int len) {
+    int j;
+    for (j = 0; j < KINO_NUM_CODECS; j++) {
+        if (len >= codecs[j].magiclen &&
+            memcmp(buf, codecs[j].magic, codecs[j].magiclen) == 0)
+            return &codecs[j];
+    }
+    return NULL;
+}
+
+const editorCodec *editorCodecFromName(const char *filename) {
+    int len = strlen(filename);
+    int j;
+    for (j = 0; j < KINO_NUM_CODECS; j++) {
+        int extlen = strlen(codecs[j].ext);
+        if (len > extlen && strcmp(&filename[len - extlen], codecs[j].ext) == 0)
+            return &codecs[j];
+    }
+    return NULL;
+}
+
+// fork a child running argv with its stdin/stdout wired to infd/outfd
+// the compressor runs in its own process, so it works on the stream while we consume/produce rows
+
+pid_t editorSpawn(char *const argv[], int infd, int outfd) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    if (infd != STDIN_FILENO) dup2(infd, STDIN_FILENO);
+    if (outfd != STDOUT_FILENO) dup2(outfd, STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull != -1) dup2(devnull, STDERR_FILENO);
+    signal(SIGPIPE, SIG_DFL);
+    execvp(argv[0], argv);
+    _exit(127);
+}
+
+// returns 0 if the child exited cleanly
+int editorReap(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+int editorWriteAll(int fd, const char *buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(fd, buf + off, len - off);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+// like editorSpawn, for an infd that can't be rewound after we sniffed prefix off it.
+// a feeder child writes prefix and then the rest of infd into argv's stdin, and exits
+// with argv's status so editorReap reports on the decompressor itself
+
+pid_t editorSpawnPrefixed(char *const argv[], const char *prefix, int prefixlen, int infd, int outfd) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1) _exit(127);
+    pid_t child = editorSpawn(argv, p[0], outfd);
+    if (child == -1) _exit(127);
+    close(p[0]);
+    close(outfd);
+
+    // a decompressor that quits early just gets EPIPE here, SIGPIPE is ignored
+    char buf[KINO_WRITE_CHUNK];
+    ssize_t n = prefixlen;
+    memcpy(buf, prefix, prefixlen);
+    while (n != 0) {
+        if (n > 0 && editorWriteAll(p[1], buf, n) == -1) break;
+        n = read(infd, buf, sizeof(buf));
+        if (n == -1 && errno != EINTR) break;
+    }
+    close(p[1]);
+    _exit(editorReap(child) == 0 ? 0 : 1);
+}
+
+// write every row followed by '\n' to fd through a small fixed staging buffer,
+// so the whole file never has to be joined into one string. returns bytes written or -1
+
+long long editorWriteRows(int fd) {
+    char buf[KINO_WRITE_CHUNK];
+    int buflen = 0;
+    long long total = 0;
+    struct coldReader cr = COLD_READER_INIT;
+    int err = 0;
+    int j;
+
+    for (j = 0; j <= E.numrows; j++) {
+        const char *s = NULL;
+        int len = 0;
+        if (j < E.numrows) {
+            s = editorColdPeek(&cr, j);
+            len = E.row[j].size;
+        }
+
+        // flush when the row doesn't fit, or at the end; rows larger than the buffer go straight out
+        if (j == E.numrows || buflen + len + 1 > KINO_WRITE_CHUNK) {
+            if ((err = editorWriteAll(fd, buf, buflen)) == -1) break;
+            total += buflen;
+            buflen = 0;
+            if (j == E.numrows) break;
+
+            if (len + 1 > KINO_WRITE_CHUNK) {
+                if ((err = editorWriteAll(fd, s, len)) == -1) break;
+                total += len;
+                len = 0;
+            }
+        }
+        memcpy(buf + buflen, s, len);
+        buflen += len;
+        buf[buflen++] = '\n';
+    }
+    editorColdReaderFree(&cr);
+    return err ? -1 : total;
+}
+
+/*** parallel load ***/
+
+// one slice of a mmapped file, turned into rows by its own thread
+
+struct loadChunk {
+    const char *data;
+    size_t size;
+    size_t start, end; // byte range, always starts at a line boundary
+    erow *rows;
+    int numrows;
+    int cap;
+    int bad; // the file shrank under us
+};
+
+void editorChunkAddRow(struct loadChunk *c, const char *s, size_t len) {
+    if (c->numrows == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 1024;
+        c->rows = realloc(c->rows, sizeof(erow) * c->cap);
+    }
+
+    // the row must be freeable before touching the mapping, which may fault (see editorLoadBus)
+    erow *row = &c->rows[c->numrows++];
+    row->size = len;
+    row->rsize = 0;
+    row->render = NULL;
+    row->stops = NULL;
+    row->stopcap = 0;
+    row->chars = malloc(len + 1);
+    if (len) memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    editorUpdateRow(row);
+}
+
+// same trimming as getline + the loop in editorOpen: drop trailing '\n' / '\r'
+void editorLoadChunkRows(struct loadChunk *c) {
+    const char *p = c->data + c->start;
+    const char *end = c->data + c->end;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *next = nl ? nl + 1 : end;
+        const char *eol = nl ? nl : end;
+        while (eol > p && eol[-1] == '\r') eol--;
+
+        editorChunkAddRow(c, p, eol - p);
+        p = next;
+    }
+}
+
+// a mapped file that shrinks under us (a log being truncated or rotated while we open it)
+// raises SIGBUS on the pages past its new end. the thread that touched them jumps back
+// out of its chunk, which is marked bad, and the open falls back to plain reads
+__thread sigjmp_buf *loadBusJmp;
+
+void editorLoadBus(int sig) {
+    if (loadBusJmp) siglongjmp(*loadBusJmp, 1);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void *editorLoadChunk(void *arg) {
+    struct loadChunk *c = arg;
+    sigjmp_buf jb;
+    if (sigsetjmp(jb, 1)) {
+        c->bad = 1;
+    } else {
+        loadBusJmp = &jb;
+        editorLoadChunkRows(c);
+    }
+    loadBusJmp = NULL;
+    return NULL;
+}
+
+int editorLoadThreads(size_t size) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = size / KINO_LOAD_MIN_CHUNK + 1;
+    if (ncpu > 0 && n > ncpu) n = ncpu;
+    if (n > KINO_LOAD_MAX_THREADS) n = KINO_LOAD_MAX_THREADS;
+    return n;
+}
+
+// chunk 0 runs on this thread; fall back to doing a chunk inline if a thread won't start
+void editorRunChunks(struct loadChunk *chunks, int nchunks) {
+    pthread_t threads[KINO_LOAD_MAX_THREADS];
+    int spawned[KINO_LOAD_MAX_THREADS] = {0};
+    int j;
+    for (j = 1; j < nchunks; j++) {
+        spawned[j] = pthread_create(&threads[j], NULL, editorLoadChunk, &chunks[j]) == 0;
+        if (!spawned[j]) editorLoadChunk(&chunks[j]);
+    }
+    editorLoadChunk(&chunks[0]);
+
+    for (j = 1; j < nchunks; j++) {
+        if (spawned[j]) pthread_join(threads[j], NULL);
+    }
+}
+
+void editorFreeChunks(struct loadChunk *chunks, int nchunks, int freerows) {
+    int j, k;
+    for (j = 0; j < nchunks; j++) {
+        if (freerows) {
+            for (k = 0; k < chunks[j].numrows; k++) editorFreeRow(&chunks[j].rows[k]);
+        }
+        free(chunks[j].rows);
+    }
+}
+
+// append the per-chunk row arrays to E.row in file order
+void editorStitchChunks(struct loadChunk *chunks, int nchunks) {
+    int total = 0;
+    int j;
+    for (j = 0; j < nchunks; j++) total += chunks[j].numrows;
+
+    E.row = realloc(E.row, sizeof(erow) * (E.numrows + total));
+    for (j = 0; j < nchunks; j++) {
+        memcpy(&E.row[E.numrows], chunks[j].rows, sizeof(erow) * chunks[j].numrows);
+        E.numrows += chunks[j].numrows;
+    }
+    editorFreeChunks(chunks, nchunks, 0);
+}
+
+// cut at the first newline after each nominal boundary so no line is split.
+// returns the number of chunks, or -1 if the file shrank under us
+int editorSplitChunks(struct loadChunk *chunks, const char *data, size_t size, int *partial) {
+    sigjmp_buf jb;
+    if (sigsetjmp(jb, 1)) {
+        loadBusJmp = NULL;
+        return -1;
+    }
+    loadBusJmp = &jb;
+    *partial = data[size - 1] != '\n';
+
+    int nchunks = editorLoadThreads(size);
+    size_t start = 0;
+    int j;
+    for (j = 0; j < nchunks; j++) {
+        size_t end = size;
+        if (j < nchunks - 1) {
+            end = size / nchunks * (j + 1);
+            if (end < start) end = start;
+            const char *nl = memchr(data + end, '\n', size - end);
+            end = nl ? (size_t)(nl - data) + 1 : size;
+        }
+        chunks[j] = (struct loadChunk){ .data = data, .size = size,
+            .start = start, .end = end };
+        start = end;
+    }
+    loadBusJmp = NULL;
+    return nchunks;
+}
+
+// mmap a regular file and build its rows on one thread per core, then stitch the
+// per-chunk row arrays onto E.row in file order. returns -1 if the file can't be mapped,
+// or changed size while we read it, so the caller reads it the slow way instead
+int editorOpenParallel(int fd, struct stat *st) {
+    size_t size = st->st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return -1;
+
+    struct sigaction sa, oldsa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorLoadBus;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, &oldsa);
+
+    struct loadChunk chunks[KINO_LOAD_MAX_THREADS];
+    int partial;
+    int nchunks = editorSplitChunks(chunks, data, size, &partial);
+    int ret = nchunks == -1 ? -1 : 0;
+    if (ret == 0) {
+        editorRunChunks(chunks, nchunks);
+        int j;
+        for (j = 0; j < nchunks; j++) {
+            if (chunks[j].bad) ret = -1;
+        }
+        if (ret == -1) {
+            editorFreeChunks(chunks, nchunks, 1);
+        } else {
+            editorStitchChunks(chunks, nchunks);
+        }
+    }
+    sigaction(SIGBUS, &oldsa, NULL);
+    munmap(data, size);
+    if (ret == -1) return -1;
+
+    E.follow_off = size;
+    E.partial = partial;
+    return 0;
+}
+
+// split buf into lines, continuing the last row if it was still waiting for its '\n'.
+// used for text that arrives in pieces: a decompressor stream, a followed file
+void editorAppendText(const char *buf, int len) {
+    int start = 0;
+    while (start < len) {
+        const char *nl = memchr(&buf[start], '\n', len - start);
+        int end = nl ? nl - buf : len;
+        int seglen = end - start;
+        if (nl) {
+            while (seglen > 0 && buf[start + seglen - 1] == '\r') seglen--;
+        }
+
+        if (E.partial && E.numrows > 0) {
+            erow *row = editorRowHot(E.numrows - 1);
+            editorRowAppendString(row, (char *)&buf[start], seglen);
+            // the '\r' of a CRLF split across two pieces is already in the row
+            while (nl && seglen == 0 && row->size > 0 && row->chars[row->size - 1] == '\r')
+                editorRowDelChar(row, row->size - 1);
+        } else {
+            editorInsertRow(E.numrows, (char *)&buf[start], seglen);
+        }
+
+        E.partial = nl == NULL;
+        start = end + 1;
+    }
 }
 
 void editorOpen(char *filename) {
@@ -446,59 +1504,685 @@ void editorOpen(char *filename) {
     free(E.filename);
     E.filename = strdup(filename);
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+
+    // sniff the magic bytes, then rewind so the decompressor sees the whole stream.
+    // pipes and FIFOs can't be rewound, so there the sniffed bytes are passed on ahead of the rest
+    char magic[4];
+    ssize_t magiclen = 0;
+    while (magiclen < (ssize_t)sizeof(magic)) {
+        ssize_t n = read(fd, magic + magiclen, sizeof(magic) - magiclen);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) die("read");
+        if (n == 0) break;
+        magiclen += n;
+    }
+    int rewound = lseek(fd, 0, SEEK_SET) != -1;
+    if (!rewound && errno != ESPIPE) die("read");
+    E.codec = editorCodecFromMagic(magic, magiclen);
+
+    // plain regular files take the parallel mmap path
+    struct stat st;
+    if (!E.codec && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        editorOpenParallel(fd, &st) == 0) {
+        close(fd);
+        E.dirty = 0;
+        editorColdRecount();
+        return;
+    }
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+    E.follow_off = 0;
+    E.partial = 0;
+    E.dirty = 0;
 
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                            line[linelen - 1] == '\r'))
-        linelen--;
-        editorInsertRow(E.numrows, line, linelen);
+    // compressed files open right away: the main loop feeds rows in as the decompressor
+    // produces them, see editorLoadWait
+    if (E.codec) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) == -1) die("pipe");
+        if (rewound)
+            E.load_pid = editorSpawn(E.codec->decompress, fd, p[1]);
+        else
+            E.load_pid = editorSpawnPrefixed(E.codec->decompress, magic, magiclen, fd, p[1]);
+        if (E.load_pid == -1) die("fork");
+        close(p[1]);
+        close(fd);
+        fcntl(p[0], F_SETFL, O_NONBLOCK);
+        E.load_fd = p[0];
+        return;
+    }
+
+    // everything else is read as a stream, starting with whatever the sniff took off a pipe
+    if (!rewound) {
+        editorAppendText(magic, magiclen);
+        E.follow_off = magiclen;
     }
-    free(line);
-    fclose(fp);
+    char buf[KINO_WRITE_CHUNK];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        editorAppendText(buf, n);
+        E.follow_off += n;
+    }
+    close(fd);
     E.dirty = 0;
+}
 
-    
+void editorLoadDone() {
+    close(E.load_fd);
+    E.load_fd = -1;
+    if (editorReap(E.load_pid) == -1)
+        editorSetStatusMessage("Warning: %s failed to decompress %s, buffer may be incomplete",
+            E.codec->name, E.filename);
+    E.load_pid = -1;
+}
+
+// turn up to KINO_LOAD_BATCH reads of decompressor output into rows
+void editorLoadRead() {
+    char buf[KINO_WRITE_CHUNK];
+    int dirty = E.dirty;
+    int j = 0;
+    while (E.load_fd != -1 && j < KINO_LOAD_BATCH) {
+        ssize_t n = read(E.load_fd, buf, sizeof(buf));
+        if (n > 0) {
+            editorAppendText(buf, n);
+            j++;
+        } else if (n == 0 || errno != EINTR) {
+            if (n == -1 && errno == EAGAIN) break;
+            editorLoadDone();
+        }
+    }
+    // rows coming off the stream are the file itself, not edits
+    E.dirty = dirty;
+}
+
+// block until a key is pending, loading rows and redrawing while we wait
+void editorLoadWait() {
+    while (E.load_fd != -1) {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {E.load_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            editorLoadRead();
+            editorRefreshScreen();
+            editorColdMaintain();
+        }
+        if (fds[0].revents & POLLIN) return;
+    }
+}
+
+// save and anything else that works on the whole file waits for the rest of it
+void editorLoadFinish() {
+    while (E.load_fd != -1) {
+        struct pollfd fd = {E.load_fd, POLLIN, 0};
+        if (poll(&fd, 1, -1) == -1 && errno != EINTR) die("poll");
+        editorLoadRead();
+    }
+}
+
+// pipe rows through the compressor into a temp file next to the original, which is only
+// replaced once the compressor exited cleanly
+void editorSaveCompressed() {
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.kino-XXXXXX", E.filename) == -1) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd == -1) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        free(tmp);
+        return;
+    }
+
+    // mkstemp makes it 0600: give it the original's mode, or what a new file would get
+    struct stat st;
+    if (stat(E.filename, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0644 & ~mask);
+    }
+
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1) goto ioerr;
+    pid_t pid = editorSpawn(E.codec->compress, p[0], fd);
+    close(p[0]);
+    if (pid == -1) {
+        close(p[1]);
+        goto ioerr;
+    }
+
+    long long len = editorWriteRows(p[1]);
+    int saved_errno = errno;
+    close(p[1]);
+    // a compressor that died early also makes our writes fail, so check it first
+    if (editorReap(pid) == -1) {
+        editorSetStatusMessage("Can't save! %s failed", E.codec->name);
+        goto fail;
+    }
+    errno = saved_errno;
+    if (len == -1 || fstat(fd, &st) == -1 || rename(tmp, E.filename) == -1) goto ioerr;
+
+    close(fd);
+    free(tmp);
+    E.dirty = 0;
+    editorSetStatusMessage("%lld bytes written to disk (%lld before %s)",
+        (long long)st.st_size, len, E.codec->name);
+    return;
+
+ioerr:
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+fail:
+    close(fd);
+    unlink(tmp);
+    free(tmp);
 }
 
 void editorSave() {
   if (E.filename == NULL) {
-    E.filename = editorPrompt("Save as: %s (ESC to cancel)");
+    E.filename = editorPrompt("Save as: %s (ESC to cancel)", 0);
     if (E.filename == NULL) {
       editorSetStatusMessage("Save aborted");
       return;
     }
+    E.codec = editorCodecFromName(E.filename);
   }
 
-    int len;
-    char *buf = editorRowsToString(&len);
+    editorLoadFinish();
+    if (E.codec) {
+        editorSaveCompressed();
+        return;
+    }
+
+    long long len = 0;
+    int j;
+    for (j = 0; j < E.numrows; j++)
+        len += E.row[j].size + 1;
 
     int fd = open(E.filename, O_RDWR | O_CREAT, 0644);  // 0644 argument give permission to read/write
 
     // safe way to not lose data if ftruncate succeeds but write fails
     if (fd != -1) {
         if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
+            if (editorWriteRows(fd) == len) {
                 close(fd);
-                free(buf);
                 E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
+                // our own write shouldn't come back as appended rows in follow mode
+                E.follow_off = len;
+                E.partial = 0;
+                editorSetStatusMessage("%lld bytes written to disk", len);
                 return;
             }
         }
         close(fd);
     }
-    free(buf);
     editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno)); // similar to perror
 
 }
 
 
+/*** follow mode ***/
+
+// like tail -F: watch the file with inotify and turn appended bytes into rows as they land
+
+#ifdef __linux__
+
+void editorFollowStop() {
+    if (E.follow_fd != -1) close(E.follow_fd);
+    if (E.follow_ifd != -1) close(E.follow_ifd);
+    E.follow_fd = -1;
+    E.follow_ifd = -1;
+    E.follow_wd = -1;
+    E.follow_dirwd = -1;
+    E.follow = 0;
+}
+
+// read everything past follow_off. only the new bytes are touched
+void editorFollowRead() {
+    struct stat st;
+    if (fstat(E.follow_fd, &st) == -1) return;
+
+    // truncated underneath us: the rows no longer describe the file. it's normally
+    // cut to (near) empty, so dropping the rows and reading from 0 is cheap.
+    // unsaved edits are never thrown away though: keep the buffer and stop following
+    if (st.st_size < E.follow_off && E.dirty) {
+        editorFollowStop();
+        editorSetStatusMessage("%s was truncated, buffer kept (modified)", E.filename);
+        return;
+    }
+    if (st.st_size < E.follow_off) {
+        while (E.numrows > 0) editorDelRow(E.numrows - 1);
+        E.follow_off = 0;
+        E.partial = 0;
+        E.cy = 0;
+        E.cx = 0;
+        E.rowoff = 0;
+        E.dirty = 0;
+        editorSetStatusMessage("%s was truncated", E.filename);
+    }
+    if (st.st_size == E.follow_off) return;
+
+    int pinned = E.cy >= E.numrows - 1;
+    int dirty = E.dirty;
+
+    char buf[KINO_WRITE_CHUNK];
+    ssize_t n;
+    while ((n = pread(E.follow_fd, buf, sizeof(buf), E.follow_off)) > 0) {
+        editorAppendText(buf, n);
+        E.follow_off += n;
+    }
+
+    // appended rows mirror what's on disk, so they don't count as edits
+    E.dirty = dirty;
+    if (pinned) {
+        E.cy = E.numrows > 0 ? E.numrows - 1 : 0;
+        E.cx = 0;
+    }
+}
+
+// attach to whatever file is at E.filename now, e.g. the fresh file after a log rotation
+int editorFollowAttach() {
+    int fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (E.follow_fd != -1) close(E.follow_fd);
+    if (E.follow_wd != -1) inotify_rm_watch(E.follow_ifd, E.follow_wd);
+    E.follow_fd = fd;
+    E.follow_ino = st.st_ino;
+    E.follow_wd = inotify_add_watch(E.follow_ifd, E.filename,
+        IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    return 0;
+}
+
+// base name of E.filename, the name rotation will recreate in the directory
+const char *editorFollowBasename() {
+    const char *slash = strrchr(E.filename, '/');
+    return slash ? slash + 1 : E.filename;
+}
+
+void editorFollowStart() {
+    if (E.filename == NULL) {
+        editorSetStatusMessage("Follow mode needs a file");
+        return;
+    }
+    if (E.codec) {
+        editorSetStatusMessage("Can't follow a %s compressed file", E.codec->name);
+        return;
+    }
+
+    E.follow_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (E.follow_ifd == -1 || editorFollowAttach() == -1 || E.follow_wd == -1) {
+        editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+        editorFollowStop();
+        return;
+    }
+
+    // the directory watch catches the new file once the old one is renamed or deleted
+    const char *base = editorFollowBasename();
+    if (base == E.filename) {
+        E.follow_dirwd = inotify_add_watch(E.follow_ifd, ".", IN_CREATE | IN_MOVED_TO);
+    } else {
+        int dirlen = base - E.filename;
+        char *dir = strndup(E.filename, dirlen > 1 ? dirlen - 1 : dirlen);
+        E.follow_dirwd = inotify_add_watch(E.follow_ifd, dir, IN_CREATE | IN_MOVED_TO);
+        free(dir);
+    }
+
+    E.follow = 1;
+    editorFollowRead();
+    if (E.follow) editorSetStatusMessage("Following %s (Ctrl-T to stop)", E.filename);
+}
+
+// drain pending inotify events and react to them
+void editorFollowHandleEvents() {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int modified = 0, gone = 0, appeared = 0;
+    ssize_t len;
+
+    while ((len = read(E.follow_ifd, buf, sizeof(buf))) > 0) {
+        char *p;
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->wd == E.follow_wd) {
+                if (ev->mask & IN_MODIFY) modified = 1;
+                if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) gone = 1;
+            } else if (ev->wd == E.follow_dirwd && ev->len &&
+                       strcmp(ev->name, editorFollowBasename()) == 0) {
+                appeared = 1;
+            }
+        }
+    }
+
+    // whatever was written before the rotation still belongs to this buffer
+    if (modified || gone || appeared) editorFollowRead();
+    if (!E.follow) return;
+
+    if (gone || appeared) {
+        struct stat st;
+        if (stat(E.filename, &st) == 0 && st.st_ino != E.follow_ino &&
+            editorFollowAttach() == 0) {
+            // rotated: keep the old rows and carry on with the new file from its start
+            E.follow_off = 0;
+            E.partial = 0;
+            E.dirty++;
+            editorFollowRead();
+            editorSetStatusMessage("%s was rotated, following the new file", E.filename);
+        } else if (gone) {
+            if (E.follow_wd != -1) inotify_rm_watch(E.follow_ifd, E.follow_wd);
+            E.follow_wd = -1;
+            editorSetStatusMessage("%s is gone, waiting for it to come back", E.filename);
+        }
+    }
+}
+
+// block until a key is pending, applying file changes while we wait
+void editorFollowWait() {
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = E.follow_ifd;
+    fds[1].events = POLLIN;
+
+    while (E.follow) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        if (fds[1].revents & POLLIN) {
+            editorFollowHandleEvents();
+            editorRefreshScreen();
+            editorColdMaintain();
+        }
+        if (fds[0].revents & POLLIN) return;
+    }
+}
+
+void editorFollowToggle() {
+    if (E.follow) {
+        editorFollowStop();
+        editorSetStatusMessage("Follow mode off");
+    } else {
+        editorFollowStart();
+    }
+}
+
+#else
+
+void editorFollowWait() {}
+
+void editorFollowToggle() {
+    editorSetStatusMessage("Follow mode needs inotify (Linux only)");
+}
+
+#endif
+
+
+/*** filter ***/
+
+// pipe a range of rows through a shell command and put its output in their place, like
+// vim's :%!sort. rows are fed straight from E.row with writev while the output is read back
+// in the same poll loop, so neither side is ever gathered into one big string
+
+#define KINO_FILTER_IOV 64
+
+struct filterState {
+    int first, last; // rows [first, last) go to the command
+    int wrow; // next row to send
+    int woff; // bytes of wrow already sent, size means only its '\n' is left
+    struct coldReader cr;
+    struct loadChunk out; // rows built from the output so far
+    char *carry; // output line still waiting for its '\n'
+    int carrylen, carrycap;
+};
+
+// push as much of the range as the pipe takes. returns -1 once the command stops reading
+int editorFilterWrite(struct filterState *f, int fd) {
+    while (f->wrow < f->last) {
+        struct iovec iov[KINO_FILTER_IOV];
+        int niov = 0;
+        int row = f->wrow;
+        int off = f->woff;
+        while (row < f->last && niov < KINO_FILTER_IOV - 1) {
+            // peeking into another cold block frees the one already queued, so stop there
+            if (niov && E.row[row].chars == NULL &&
+                (row < f->cr.first || row >= f->cr.first + f->cr.count))
+                break;
+            const char *chars = editorColdPeek(&f->cr, row);
+            if (off < E.row[row].size)
+                iov[niov++] = (struct iovec){(char *)chars + off, E.row[row].size - off};
+            iov[niov++] = (struct iovec){"\n", 1};
+            row++;
+            off = 0;
+        }
+
+        ssize_t n = writev(fd, iov, niov);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        // advance over what was taken, possibly stopping inside a row
+        while (n > 0) {
+            int left = E.row[f->wrow].size - f->woff + 1;
+            if (n < left) {
+                f->woff += n;
+                break;
+            }
+            n -= left;
+            f->wrow++;
+            f->woff = 0;
+        }
+    }
+    return 0;
+}
+
+// split command output into rows, trimming CR/LF like editorOpen does
+void editorFilterRead(struct filterState *f, const char *buf, int len) {
+    int start = 0;
+    while (start < len) {
+        const char *nl = memchr(&buf[start], '\n', len - start);
+        int end = nl ? nl - buf : len;
+        int seglen = end - start;
+
+        if (f->carrylen + seglen > f->carrycap) {
+            f->carrycap = (f->carrylen + seglen) * 2;
+            f->carry = realloc(f->carry, f->carrycap);
+        }
+        if (seglen) memcpy(f->carry + f->carrylen, &buf[start], seglen);
+        f->carrylen += seglen;
+
+        if (nl) {
+            while (f->carrylen > 0 && f->carry[f->carrylen - 1] == '\r') f->carrylen--;
+            editorChunkAddRow(&f->out, f->carry, f->carrylen);
+            f->carrylen = 0;
+        }
+        start = end + 1;
+    }
+}
+
+// swap rows [at, at + count) for rows in one go
+void editorReplaceRows(int at, int count, erow *rows, int n) {
+    int j;
+    // the first shift thaws every block touching the range, so the second never has to
+    // thaw anything while E.row is between layouts
+    editorColdShift(at, -count);
+    for (j = at; j < at + count; j++) {
+        E.hot_bytes -= editorRowBytes(&E.row[j]);
+        editorFreeRow(&E.row[j]);
+    }
+    editorColdShift(at, n);
+
+    if (n > count) E.row = realloc(E.row, sizeof(erow) * (E.numrows - count + n));
+    if (E.numrows - at - count)
+        memmove(&E.row[at + n], &E.row[at + count], sizeof(erow) * (E.numrows - at - count));
+    if (n) memcpy(&E.row[at], rows, sizeof(erow) * n);
+    for (j = at; j < at + n; j++) E.hot_bytes += editorRowBytes(&E.row[j]);
+    E.numrows += n - count;
+    E.dirty++;
+}
+
+// "%!cmd" filters the whole buffer, "N,M!cmd" rows N to M, "!cmd" or "cmd" the cursor row
+int editorFilterParse(char *input, int *first, int *last, char **cmd) {
+    char *bang = strchr(input, '!');
+    *first = E.cy;
+    *last = E.cy + 1;
+    *cmd = input;
+    if (bang == NULL) return 0;
+
+    *cmd = bang + 1;
+    if (bang == input) return 0;
+    if (input[0] == '%' && bang == input + 1) {
+        *first = 0;
+        *last = E.numrows;
+        return 0;
+    }
+
+    int a, b;
+    char end;
+    if (sscanf(input, "%d,%d%c", &a, &b, &end) == 3 && end == '!') {
+        *first = a - 1;
+        *last = b;
+    } else if (sscanf(input, "%d%c", &a, &end) == 2 && end == '!') {
+        *first = a - 1;
+        *last = a;
+    } else {
+        return -1;
+    }
+    if (*first < 0 || *last > E.numrows || *first >= *last) return -1;
+    return 0;
+}
+
+void editorFilterRows(int first, int last, char *cmd) {
+    struct filterState f = {0};
+    f.first = first;
+    f.last = last < E.numrows ? last : E.numrows;
+    f.wrow = f.first;
+    f.cr = (struct coldReader)COLD_READER_INIT;
+
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) == -1) {
+        editorSetStatusMessage("Can't filter: %s", strerror(errno));
+        return;
+    }
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        editorSetStatusMessage("Can't filter: %s", strerror(errno));
+        close(in[0]);
+        close(in[1]);
+        return;
+    }
+    char *argv[] = {"/bin/sh", "-c", cmd, NULL};
+    pid_t pid = editorSpawn(argv, in[0], out[1]);
+    close(in[0]);
+    close(out[1]);
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    int wfd = in[1];
+    int rfd = out[0];
+    if (pid == -1 || f.wrow == f.last) {
+        close(wfd);
+        wfd = -1;
+    }
+    if (pid == -1) {
+        close(rfd);
+        rfd = -1;
+    }
+
+    int cancelled = 0;
+    int rounds = 0;
+    char buf[KINO_WRITE_CHUNK];
+    while (rfd != -1 && !cancelled) {
+        struct pollfd fds[3];
+        int nfds = 0;
+        fds[nfds++] = (struct pollfd){STDIN_FILENO, POLLIN, 0};
+        fds[nfds++] = (struct pollfd){rfd, POLLIN, 0};
+        if (wfd != -1) fds[nfds++] = (struct pollfd){wfd, POLLOUT, 0};
+
+        int ready = poll(fds, nfds, 100);
+        if (ready == -1 && errno != EINTR) break;
+        // a command that never goes quiet (%!yes) still gets progress shown now and then
+        if (ready <= 0 || ++rounds % KINO_FILTER_REDRAW == 0) {
+            editorSetStatusMessage("Filtering: %d/%d rows sent, %d read (Ctrl-C to cancel)",
+                f.wrow - f.first, f.last - f.first, f.out.numrows);
+            editorRefreshScreen();
+            if (ready <= 0) continue;
+        }
+
+        // arrows and the like arrive as escape sequences too, only a bare ESC cancels
+        if (fds[0].revents & POLLIN) {
+            int c = editorReadKey();
+            if (c == CTRL_KEY('c') || c == '\x1b') cancelled = 1;
+        }
+        if (wfd != -1 && (fds[2].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            // done, or the command quit reading early: either way it gets EOF
+            if (editorFilterWrite(&f, wfd) == -1 || f.wrow == f.last) {
+                close(wfd);
+                wfd = -1;
+            }
+        }
+        // a bounded batch per round, so keys are still seen while output keeps coming
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = 0;
+            int j;
+            for (j = 0; j < KINO_LOAD_BATCH && (n = read(rfd, buf, sizeof(buf))) > 0; j++)
+                editorFilterRead(&f, buf, n);
+            if (n == 0) {
+                close(rfd);
+                rfd = -1;
+            }
+        }
+    }
+    if (wfd != -1) close(wfd);
+    if (rfd != -1) close(rfd);
+    if (cancelled) kill(pid, SIGTERM);
+    int status = pid == -1 ? -1 : editorReap(pid);
+    editorColdReaderFree(&f.cr);
+
+    // a last line without '\n' is still a line
+    if (f.carrylen) editorChunkAddRow(&f.out, f.carry, f.carrylen);
+    free(f.carry);
+
+    // no undo, so a command that failed halfway never gets to replace anything
+    if (cancelled || status == -1) {
+        editorFreeChunks(&f.out, 1, 1);
+        if (cancelled) editorSetStatusMessage("Filter cancelled");
+        else editorSetStatusMessage("Filter failed: %s", cmd);
+    } else {
+        editorReplaceRows(f.first, f.last - f.first, f.out.rows, f.out.numrows);
+        editorFreeChunks(&f.out, 1, 0);
+        editorSetStatusMessage("Filtered %d rows into %d", f.last - f.first, f.out.numrows);
+        E.lastedit = f.first;
+        if (E.cy > E.numrows) E.cy = E.numrows;
+        if (E.cy < E.numrows && E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+    }
+}
+
+void editorFilter() {
+    char *input = editorPrompt("Filter: %s (%%!cmd, N,M!cmd or !cmd, ESC to cancel)", 0);
+    if (input == NULL) return;
+    editorLoadFinish();
+
+    int first, last;
+    char *cmd;
+    if (editorFilterParse(input, &first, &last, &cmd) == -1 || *cmd == '\0')
+        editorSetStatusMessage("Bad filter: %s", input);
+    else
+        editorFilterRows(first, last, cmd);
+    free(input);
+}
+
 /*** append buffer ***/
 struct abuf {
     char *b;
@@ -509,6 +2193,9 @@ struct abuf {
 
 //append string to buffer
 void abAppend(struct abuf *ab, const char *s, int len) {
+    // nothing to add, and realloc(b, 0) on a reused empty buffer would free it
+    if (len == 0) return;
+
     // use realloce to get a block of memory with size of current str + str
     char *new = realloc(ab->b, ab->len + len);
 
@@ -529,7 +2216,7 @@ void editorScroll() {
 
     E.rx = 0;
     if (E.cy < E.numrows) {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        E.rx = editorRowCxToRx(editorRowHot(E.cy), E.cx);
     }
 
     // checks if cursor is above the visible window
@@ -551,9 +2238,103 @@ void editorScroll() {
 }
 
 
+// lines are only sent when they differ from what the terminal already shows.
+// each one is positioned explicitly, since untouched lines are skipped
+
+void editorFlushLine(struct abuf *ab, int y, struct abuf *line) {
+    unsigned int h = 2166136261u; // FNV-1a
+    int j;
+    for (j = 0; j < line->len; j++) {
+        h ^= (unsigned char)line->b[j];
+        h *= 16777619u;
+    }
+    if (h == 0) h = 1;
+    if (E.screenhash[y] == h) return;
+    E.screenhash[y] = h;
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    abAppend(ab, buf, len);
+    abAppend(ab, line->b, line->len);
+}
+
+void editorInvalidateScreen() {
+    memset(E.screenhash, 0, sizeof(unsigned int) * (E.screenrows + 2));
+    E.drawn_rowoff = -1;
+    E.drawn_coloff = -1;
+}
+
+// when the view moved by less than a screen, let the terminal shift the text area itself:
+// limit scrolling to the text rows with DECSTBM, then LF at the bottom margin scrolls up
+// and RI (ESC M) at the top scrolls down. only the exposed lines are left to draw
+
+void editorScrollScreen(struct abuf *ab) {
+    int d = E.rowoff - E.drawn_rowoff;
+    int n = d > 0 ? d : -d;
+    if (E.drawn_rowoff == -1 || E.coloff != E.drawn_coloff || d == 0 || n >= E.screenrows)
+        return;
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[1;%dr", E.screenrows);
+    abAppend(ab, buf, len);
+    if (d > 0) {
+        len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", E.screenrows);
+        abAppend(ab, buf, len);
+        while (n--) abAppend(ab, "\n", 1);
+        memmove(E.screenhash, &E.screenhash[d], sizeof(unsigned int) * (E.screenrows - d));
+        memset(&E.screenhash[E.screenrows - d], 0, sizeof(unsigned int) * d);
+    } else {
+        abAppend(ab, "\x1b[H", 3);
+        while (n--) abAppend(ab, "\x1bM", 2);
+        memmove(&E.screenhash[-d], E.screenhash, sizeof(unsigned int) * (E.screenrows + d));
+        memset(E.screenhash, 0, sizeof(unsigned int) * -d);
+    }
+    abAppend(ab, "\x1b[r", 3);
+}
+
+// long rows have no render: only the columns on screen are expanded, straight from chars.
+// with no tabs a column is a char index, otherwise the row is walked from the last stop before coloff
+
+void editorDrawLongRow(struct abuf *ab, erow *row) {
+    int end = E.coloff + E.screencols;
+    if (row->tabs == 0) {
+        int to = end < row->size ? end : row->size;
+        int j = E.coloff;
+        if (j < to && j < row->gap) {
+            int n = (to < row->gap ? to : row->gap) - j;
+            abAppend(ab, &row->chars[j], n);
+            j += n;
+        }
+        if (j < to) abAppend(ab, &row->chars[j + row->gaplen], to - j);
+        return;
+    }
+
+    char buf[KINO_TAB_STOP];
+    int k = editorRowStop(row, row->size, E.coloff);
+    int rx = row->stops[k];
+    int j;
+    for (j = k * KINO_RX_STEP; j < row->size && rx < end; j++) {
+        char c = row->chars[j < row->gap ? j : j + row->gaplen];
+        int n = 0;
+        if (c == '\t') {
+            do buf[n++] = ' ';
+            while ((rx + n) % KINO_TAB_STOP != 0);
+        } else {
+            buf[n++] = c;
+        }
+        // clip to [coloff, end)
+        int from = rx < E.coloff ? E.coloff - rx : 0;
+        int to = rx + n > end ? end - rx : n;
+        if (from < to) abAppend(ab, &buf[from], to - from);
+        rx += n;
+    }
+}
+
 void editorDrawRows(struct abuf *ab) {
+        struct abuf line = ABUF_INIT;
         int y;
         for (y = 0; y < E.screenrows; y++) {
+            line.len = 0;
             int filerow = y + E.rowoff;
             if (filerow >= E.numrows) {
             if (E.numrows == 0 && y == E.screenrows / 3) {
@@ -563,24 +2344,30 @@ void editorDrawRows(struct abuf *ab) {
                 if (welcomelen > E.screencols) welcomelen = E.screencols;
                 int padding = (E.screencols - welcomelen) / 2;
                 if (padding) {
-                abAppend(ab, "~", 1);
+                abAppend(&line, "~", 1);
                 padding--;
                 }
-                while (padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
+                while (padding--) abAppend(&line, " ", 1);
+                abAppend(&line, welcome, welcomelen);
             } else {
-                abAppend(ab, "~", 1);
+                abAppend(&line, "~", 1);
             }
             } else {
-            int len = E.row[filerow].rsize - E.coloff;
+            erow *row = editorRowHot(filerow);
+            if (row->render == NULL) {
+                editorDrawLongRow(&line, row);
+            } else {
+            int len = row->rsize - E.coloff;
             if (len < 0) len = 0;
             if (len > E.screencols) len = E.screencols;
-            abAppend(ab, &E.row[filerow].render[E.coloff], len);
+            abAppend(&line, &row->render[E.coloff], len);
+            }
             }
 
-            abAppend(ab, "\x1b[K", 3);
-            abAppend(ab, "\r\n", 2);
+            abAppend(&line, "\x1b[K", 3);
+            editorFlushLine(ab, y, &line);
         }
+        abFree(&line);
 }
 
 
@@ -595,8 +2382,14 @@ void editorDrawStatusBar(struct abuf *ab) {
     int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
         E.filename ? E.filename : "[No Name]", E.numrows,
         E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-        E.cy + 1, E.numrows);
+    int rlen;
+    if (E.membudget && E.cold_hits + E.cold_misses > 0) {
+        rlen = snprintf(rstatus, sizeof(rstatus), "cold %d blk %lld%% hit | %d/%d",
+            E.numcold, E.cold_hits * 100 / (E.cold_hits + E.cold_misses), E.cy + 1, E.numrows);
+    } else {
+        rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
+            E.cy + 1, E.numrows);
+    }
     if (len > E.screencols) len = E.screencols;
     abAppend(ab, status, len);
     while (len < E.screencols) {
@@ -609,7 +2402,6 @@ void editorDrawStatusBar(struct abuf *ab) {
         }
     }
     abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
 }
 
 void editorDrawMessageBar(struct abuf *ab) {
@@ -631,12 +2423,24 @@ void editorRefreshScreen(){
     // J is removed because we added [K in editorDrawRows
     // K removes part of current line. the argument specifies the behaviour
 
+    // ?2026 is synchronized output: the terminal shows the frame only once it's complete.
+    // terminals that don't know it ignore it
+
+    abAppend(&ab, "\x1b[?2026h", 8);
     abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
 
+    editorScrollScreen(&ab);
+    E.drawn_rowoff = E.rowoff;
+    E.drawn_coloff = E.coloff;
     editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+
+    struct abuf line = ABUF_INIT;
+    editorDrawStatusBar(&line);
+    editorFlushLine(&ab, E.screenrows, &line);
+    line.len = 0;
+    editorDrawMessageBar(&line);
+    editorFlushLine(&ab, E.screenrows + 1, &line);
+    abFree(&line);
 
     char buf[32];
     snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
@@ -644,6 +2448,7 @@ void editorRefreshScreen(){
     abAppend(&ab, buf, strlen(buf));
 
     abAppend(&ab, "\x1b[?25h", 6);
+    abAppend(&ab, "\x1b[?2026l", 8);
 
     write(STDOUT_FILENO, ab.b, ab.len);
     abFree(&ab);
@@ -668,9 +2473,9 @@ void editorSetStatusMessage(const char *fmt, ...) {
 
 
 
-// ask user for filename
+// ask user for filename, or any other line of input. allowempty lets enter accept ""
 
-char *editorPrompt(char *prompt) {
+char *editorPrompt(char *prompt, int allowempty) {
   size_t bufsize = 128;
   char *buf = malloc(bufsize);
 
@@ -689,7 +2494,7 @@ char *editorPrompt(char *prompt) {
       free(buf);
       return NULL;
     } else if (c == '\r') {
-      if (buflen != 0) {
+      if (buflen != 0 || allowempty) {
         editorSetStatusMessage("");
         return buf;
       }
@@ -811,7 +2616,22 @@ void editorProcessKeyPress() {
       editorMoveCursor(c);
       break;
 
+    case CTRL_KEY('t'):
+      editorFollowToggle();
+      break;
+
+    case CTRL_KEY('r'):
+      editorReplaceAll();
+      break;
+
+    case CTRL_KEY('p'):
+      editorFilter();
+      break;
+
     case CTRL_KEY('l'):
+      editorInvalidateScreen();
+      break;
+
     case '\x1b':
       break;
 
@@ -840,11 +2660,40 @@ void initEditor() {
     E.row = NULL;
     E.dirty = 0;
     E.filename = NULL;
+    E.codec = NULL;
+    E.load_fd = -1;
+    E.load_pid = -1;
+    E.partial = 0;
+    E.follow_off = 0;
+    E.follow = 0;
+    E.follow_ifd = -1;
+    E.follow_wd = -1;
+    E.follow_dirwd = -1;
+    E.follow_fd = -1;
+    E.cold = NULL;
+    E.numcold = 0;
+    E.lru = NULL;
+    E.numlru = 0;
+    E.hot_bytes = 0;
+    E.cold_hits = 0;
+    E.cold_misses = 0;
+    E.lastedit = 0;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
 
     if (getWindowSize(&E.screenrows, &E.screencols) == -1)die("getWindowSize");
     E.screenrows -= 2;
+    E.screenhash = calloc(E.screenrows + 2, sizeof(unsigned int));
+    E.drawn_rowoff = -1;
+    E.drawn_coloff = -1;
+
+    // KINO_MEM_BUDGET=<MB> turns on compression of rows far from the viewport
+    char *budget = getenv("KINO_MEM_BUDGET");
+    E.membudget = budget ? atoll(budget) * 1024 * 1024 : 0;
+    if (E.membudget < 0) E.membudget = 0;
+
+    // a compressor or filter that exits early must not take the editor down with it
+    signal(SIGPIPE, SIG_IGN);
 }
 
 int main(int argc, char *argv[]) {
@@ -855,11 +2704,16 @@ int main(int argc, char *argv[]) {
     }
 
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit");
+    // keep any warning editorOpen left for the user
+    if (E.statusmsg[0] == '\0')
+        editorSetStatusMessage("HELP: Ctrl-S save | Ctrl-Q quit | Ctrl-R replace | Ctrl-T follow | Ctrl-P filter");
 
 
     while(1) {
         editorRefreshScreen();
+        editorColdMaintain();
+        if (E.load_fd != -1) editorLoadWait();
+        if (E.follow) editorFollowWait();
         editorProcessKeyPress();
     }
 